@@ -0,0 +1,342 @@
+/** @file */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "strafelib.hpp"
+
+/// A fixed set of worker threads that run a job together.
+///
+/// Unlike the rest of the library, this needs the threading support of the platform,
+/// such as \c -pthread with GCC, which is why it lives in its own header. The threads
+/// are started once and reused by every call to run(), so that many short jobs do not
+/// pay for creating threads.
+class thread_pool {
+public:
+    /// Start a pool of \p num_threads workers, or one per hardware thread if zero.
+    ///
+    /// The thread calling run() is worker 0, so only \p num_threads - 1 threads are
+    /// started.
+    explicit thread_pool(int num_threads = 0)
+    {
+        if (num_threads <= 0) {
+            num_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+        num_threads_ = num_threads;
+        for (int i = 1; i < num_threads; ++i) {
+            threads_.emplace_back([this, i] { work(i); });
+        }
+    }
+
+    ~thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (std::thread &t : threads_) {
+            t.join();
+        }
+    }
+
+    thread_pool(const thread_pool &) = delete;
+    thread_pool &operator=(const thread_pool &) = delete;
+
+    /// Return the number of workers, including the calling thread.
+    int size() const
+    {
+        return num_threads_;
+    }
+
+    /// Call \p job once on every worker with the index of the worker, and wait for all of them.
+    ///
+    /// If any call throws, the first exception is rethrown here after all workers finish.
+    void run(const std::function<void(int)> &job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &job;
+            error_ = nullptr;
+            pending_ = num_threads_ - 1;
+            ++generation_;
+        }
+        start_cv_.notify_all();
+        call(0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [this] { return pending_ == 0; });
+        job_ = nullptr;
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    void call(int worker)
+    {
+        try {
+            (*job_)(worker);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+    }
+
+    void work(int worker)
+    {
+        unsigned seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_cv_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+                if (stop_) {
+                    return;
+                }
+                seen = generation_;
+            }
+            call(worker);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                --pending_;
+            }
+            done_cv_.notify_one();
+        }
+    }
+
+    int num_threads_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(int)> *job_ = nullptr;
+    std::exception_ptr error_;
+    unsigned generation_ = 0;
+    int pending_ = 0;
+    bool stop_ = false;
+};
+
+/// The initial conditions of a run of run_ensemble().
+template<typename T = double>
+struct ensemble_input {
+    /// The initial speed, with the velocity pointing along the x axis.
+    T speed;
+    /// The constant angle between the velocity and the wish direction, as given to fme_vel_theta().
+    T costheta;
+    T sintheta;
+    /// The player frame time, for example from tau_g_to_p().
+    T tau;
+    T L;
+    T ke_tau_M_A;
+};
+
+/// The summary of a run of run_ensemble().
+template<typename T = double>
+struct ensemble_summary {
+    /// The final velocity.
+    T vel[2];
+    /// The final speed.
+    T speed;
+    /// The distance travelled, moving by the velocity after the FME in each frame as in the game.
+    T distance;
+};
+
+/// Run many independent strafing runs for \p frames frames on a thread pool.
+///
+/// Each run starts with its own ensemble_input. In every frame, fric_vel() with the
+/// stop speed \p E and the friction \p k times the frame time of the run is applied if
+/// \p ground is set, followed by fme_vel_theta() at the constant angle of the run. A
+/// stopped player is not accelerated, like in player_step(). The summary of each run is
+/// written to the same index of \p out.
+///
+/// The runs are handed out to the workers in blocks of 64, which are stepped side by
+/// side in SoA layout with fric_vel_batch() and fme_vel_theta_batch(), so that each
+/// worker fills the vector lanes across runs. As in player_step(), the speed after the
+/// friction comes from fric_speed() rather than a square root. Blocks are claimed from a
+/// shared counter, so faster workers take more blocks.
+template<typename T = double>
+void run_ensemble(thread_pool &pool, const ensemble_input<T> *inputs, ensemble_summary<T> *out, int count, int frames, bool ground, scalar_t<T> E, scalar_t<T> k)
+{
+    constexpr int block = 64;
+    const int num_blocks = (count + block - 1) / block;
+    std::atomic<int> next(0);
+    pool.run([&](int) {
+        T vx[block], vy[block], speed[block], fme_speeds[block], distance[block];
+        T costheta[block], sintheta[block], tau[block], L[block], ke_tau_M_A[block];
+        T Es[block], tau_k[block];
+        for (int b = next++; b < num_blocks; b = next++) {
+            const int first = b * block;
+            const int lanes = std::min(block, count - first);
+            for (int i = 0; i < lanes; ++i) {
+                const ensemble_input<T> &in = inputs[first + i];
+                vx[i] = in.speed;
+                vy[i] = 0;
+                speed[i] = in.speed;
+                distance[i] = 0;
+                costheta[i] = in.costheta;
+                sintheta[i] = in.sintheta;
+                tau[i] = in.tau;
+                L[i] = in.L;
+                ke_tau_M_A[i] = in.ke_tau_M_A;
+                Es[i] = E;
+                tau_k[i] = in.tau * k;
+            }
+
+            for (int f = 0; f < frames; ++f) {
+                if (ground) {
+                    fric_vel_batch<T>(vx, vy, speed, Es, tau_k, lanes);
+                    for (int i = 0; i < lanes; ++i) {
+                        speed[i] = fric_speed<T>(speed[i], E, tau_k[i]);
+                    }
+                }
+                // Any nonzero speed leaves the zero velocity of a stopped player unchanged.
+                for (int i = 0; i < lanes; ++i) {
+                    fme_speeds[i] = speed[i] > 0 ? speed[i] : 1;
+                }
+                fme_vel_theta_batch<T>(vx, vy, fme_speeds, costheta, sintheta, L, ke_tau_M_A, lanes);
+                for (int i = 0; i < lanes; ++i) {
+                    speed[i] = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+                    distance[i] += tau[i] * speed[i];
+                }
+            }
+
+            for (int i = 0; i < lanes; ++i) {
+                ensemble_summary<T> &o = out[first + i];
+                o.vel[0] = vx[i];
+                o.vel[1] = vy[i];
+                o.speed = speed[i];
+                o.distance = distance[i];
+            }
+        }
+    });
+}
+
+/// Call \p fn for every index in \f$[0, \text{count})\f$ on a thread pool, balancing uneven costs.
+///
+/// \p fn is called as <tt>fn(i, worker)</tt>, exactly once for each index \c i, with the
+/// index of the worker calling it. The indices are first split into a contiguous range per
+/// worker. Each worker takes chunks from the front of its own range, sized to an eighth
+/// of what remains but at least \p min_chunk, so that the chunks shrink as the range runs
+/// out. A worker whose range is empty steals the back half of the range of another worker,
+/// so that no worker idles while others still have a long tail of expensive indices.
+template<typename F>
+void parallel_for_stealing(thread_pool &pool, int count, int min_chunk, const F &fn)
+{
+    struct range {
+        std::mutex mutex;
+        int begin;
+        int end;
+        // Keep the ranges of different workers on different cache lines.
+        char padding[64];
+    };
+
+    const int n = pool.size();
+    std::vector<range> ranges(n);
+    for (int w = 0; w < n; ++w) {
+        ranges[w].begin = static_cast<int>(static_cast<long long>(count) * w / n);
+        ranges[w].end = static_cast<int>(static_cast<long long>(count) * (w + 1) / n);
+    }
+    min_chunk = std::max(1, min_chunk);
+
+    pool.run([&](int w) {
+        range &own = ranges[w];
+        for (;;) {
+            int b = 0;
+            int e = 0;
+            {
+                std::lock_guard<std::mutex> lock(own.mutex);
+                const int remaining = own.end - own.begin;
+                if (remaining > 0) {
+                    b = own.begin;
+                    e = b + std::min(remaining, std::max(min_chunk, remaining / 8));
+                    own.begin = e;
+                }
+            }
+            if (b < e) {
+                for (int i = b; i < e; ++i) {
+                    fn(i, w);
+                }
+                continue;
+            }
+
+            for (int j = 1; j < n && b == e; ++j) {
+                range &victim = ranges[(w + j) % n];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                const int remaining = victim.end - victim.begin;
+                if (remaining > 0) {
+                    e = victim.end;
+                    b = e - (remaining + 1) / 2;
+                    victim.end = b;
+                }
+            }
+            if (b == e) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(own.mutex);
+            own.begin = b;
+            own.end = e;
+        }
+    });
+}
+
+/// The values of each parameter of sweep_grid().
+template<typename T = double>
+struct sweep_axes {
+    /// The game frame rates, converted to the player frame time with tau_g_to_p().
+    const T *fps;
+    int num_fps;
+    /// The constant angles in radians between the velocity and the wish direction.
+    const T *theta;
+    int num_theta;
+    const T *L;
+    int num_L;
+    /// The accelerations \f$k_e MA\f$ per second, multiplied by the player frame time
+    /// to obtain \p ke_tau_M_A.
+    const T *ke_M_A;
+    int num_ke_M_A;
+};
+
+/// Evaluate a function over every combination of the parameters on a thread pool.
+///
+/// For every cell, \p fn is called as <tt>fn(tau, costheta, sintheta, L, ke_tau_M_A)</tt>
+/// and its result is stored in the dense grid \p out, indexed in row-major order with
+/// the frame rate as the slowest and \f$k_e MA\f$ as the fastest varying parameter. The
+/// cells are scheduled with parallel_for_stealing(), because their costs are typically
+/// very uneven, for example when some cells return early in a degenerate regime while
+/// others iterate long chains of frames.
+template<typename T, typename F>
+void sweep_grid(thread_pool &pool, const sweep_axes<T> &axes, T *out, const F &fn)
+{
+    std::vector<T> tau(axes.num_fps);
+    for (int i = 0; i < axes.num_fps; ++i) {
+        tau[i] = tau_g_to_p<T>(1 / axes.fps[i]);
+    }
+    std::vector<T> costheta(axes.num_theta);
+    std::vector<T> sintheta(axes.num_theta);
+    for (int i = 0; i < axes.num_theta; ++i) {
+        costheta[i] = std::cos(axes.theta[i]);
+        sintheta[i] = std::sin(axes.theta[i]);
+    }
+
+    const int count = axes.num_fps * axes.num_theta * axes.num_L * axes.num_ke_M_A;
+    parallel_for_stealing(pool, count, 1, [&](int cell, int) {
+        int rest = cell;
+        const int i_ke = rest % axes.num_ke_M_A;
+        rest /= axes.num_ke_M_A;
+        const int i_L = rest % axes.num_L;
+        rest /= axes.num_L;
+        const int i_theta = rest % axes.num_theta;
+        const int i_fps = rest / axes.num_theta;
+        const T t = tau[i_fps];
+        out[cell] = fn(t, costheta[i_theta], sintheta[i_theta], axes.L[i_L], t * axes.ke_M_A[i_ke]);
+    });
+}
@@ -1,7 +1,52 @@
 #define CATCH_CONFIG_MAIN
 #define CATCH_CONFIG_ENABLE_BENCHMARKING
 #include "catch.hpp"
+#include <random>
 #include "strafelib.hpp"
+#include "strafelib_parallel.hpp"
+
+TEST_CASE("batched dot products and norms", "[vector]") {
+    SECTION("SoA layout") {
+        const int count = 5;
+        const double a[2 * count] = {3, 0, -5, 1, 8, 4, 2, 12, 1, 6};
+        const double b[2 * count] = {1, 1, 1, 2, 0, 1, 1, 1, 3, 0.5};
+        double dots[count];
+        double norms[count];
+        dot_product_batch<2>(a, b, dots, count);
+        norm_batch<2>(a, norms, count);
+        for (int i = 0; i < count; ++i) {
+            const double ai[2] = {a[i], a[count + i]};
+            const double bi[2] = {b[i], b[count + i]};
+            REQUIRE(dots[i] == dot_product<2>(ai, bi));
+            REQUIRE(norms[i] == Approx(std::sqrt(dot_product<2>(ai, ai))).epsilon(1e-15));
+        }
+        REQUIRE(norms[0] == Approx(5));
+        REQUIRE(norms[2] == Approx(13));
+    }
+    SECTION("strided AoS layout") {
+        const int count = 3;
+        const double a[4 * count] = {
+            1, 2, 2, -1,
+            0, 3, 4, -1,
+            6, 0, 8, -1,
+        };
+        const double b[3 * count] = {
+            1, 0, 0,
+            0, 1, 1,
+            0.5, 0.5, 0.5,
+        };
+        double dots[count];
+        double norms[count];
+        dot_product_strided<3>(a, 4, b, 3, dots, count);
+        norm_strided<3>(a, 4, norms, count);
+        REQUIRE(dots[0] == 1);
+        REQUIRE(dots[1] == 7);
+        REQUIRE(dots[2] == 7);
+        REQUIRE(norms[0] == Approx(3));
+        REQUIRE(norms[1] == Approx(5));
+        REQUIRE(norms[2] == Approx(10));
+    }
+}
 
 TEST_CASE("friction on speed", "[friction]") {
     SECTION("geometric friction at 1000fps") {
@@ -12,6 +57,91 @@ TEST_CASE("friction on speed", "[friction]") {
     }
 }
 
+TEST_CASE("friction on speed over n frames", "[friction]") {
+    auto iterate = [](double speed, double E, double tau_k, int n) {
+        for (int i = 0; i < n; ++i) {
+            speed = fric_speed(speed, E, tau_k);
+        }
+        return speed;
+    };
+
+    SECTION("matches iterated fric_speed at 1000fps") {
+        const double speeds[] = {2000, 320, 100, 99.9, 80, 0.5, 0.05, 0};
+        const int frames[] = {0, 1, 10, 300, 1000, 1500, 3000};
+        for (double speed : speeds) {
+            for (int n : frames) {
+                REQUIRE(fric_speed_n(speed, 100, 4. / 1000, n) == Approx(iterate(speed, 100, 4. / 1000, n)).margin(1e-9));
+            }
+        }
+    }
+    SECTION("geometric friction at 100fps") {
+        REQUIRE(fric_speed_n(320, 100, 4. / 100, 10) == Approx(320 * std::pow(0.96, 10)));
+    }
+    SECTION("stops after the arithmetic friction") {
+        REQUIRE(fric_speed_n(80, 100, 4. / 1000, 199) == Approx(0.4));
+        REQUIRE(fric_speed_n(80, 100, 4. / 1000, 200) == 0);
+    }
+    SECTION("no frames") {
+        REQUIRE(fric_speed_n(320, 100, 0.004, 0) == 320);
+        REQUIRE(fric_speed_n(320, 100, 0.004, -3) == 320);
+    }
+}
+
+TEST_CASE("friction frames to speed", "[friction]") {
+    auto iterate = [](double speed, double E, double tau_k, double target) {
+        int frames = 0;
+        while (speed > target) {
+            speed = fric_speed(speed, E, tau_k);
+            ++frames;
+        }
+        return frames;
+    };
+
+    SECTION("matches iterated fric_speed at 1000fps") {
+        const double speeds[] = {2000, 320, 100, 80, 0.5};
+        const double targets[] = {1000, 300, 100, 99, 50, 0.3, 0};
+        for (double speed : speeds) {
+            for (double target : targets) {
+                REQUIRE(fric_frames_to_speed(speed, 100, 4. / 1000, target) == iterate(speed, 100, 4. / 1000, target));
+            }
+        }
+    }
+    SECTION("never slows down without friction") {
+        REQUIRE(fric_frames_to_speed(320, 100, 0, 200) == -1);
+        REQUIRE(fric_frames_to_speed(320, 100, 0.004, -1) == -1);
+    }
+}
+
+TEST_CASE("friction distance over n frames", "[friction]") {
+    auto simulate = [](double vx, double vy, double E, double tau_k, int n, double tau, double *disp) {
+        double vel[2] = {vx, vy};
+        disp[0] = 0;
+        disp[1] = 0;
+        for (int i = 0; i < n; ++i) {
+            fric_vel(vel, std::sqrt(dot_product<2>(vel, vel)), E, tau_k);
+            disp[0] += tau * vel[0];
+            disp[1] += tau * vel[1];
+        }
+    };
+
+    SECTION("matches stepping the position") {
+        const int frames[] = {1, 10, 300, 1000, 3000};
+        for (int n : frames) {
+            double expected[2];
+            simulate(300, -400, 100, 4. / 1000, n, 0.001, expected);
+            double disp[2];
+            const double vel[2] = {300, -400};
+            fric_displacement_n(vel, 500, 100, 4. / 1000, n, 0.001, disp);
+            REQUIRE(disp[0] == Approx(expected[0]).epsilon(1e-9));
+            REQUIRE(disp[1] == Approx(expected[1]).epsilon(1e-9));
+            REQUIRE(fric_distance_n(500, 100, 4. / 1000, n, 0.001) == Approx(std::hypot(expected[0], expected[1])).epsilon(1e-9));
+        }
+    }
+    SECTION("arithmetic friction only") {
+        REQUIRE(fric_distance_n(80, 100, 4. / 1000, 1000, 0.001) == Approx(0.001 * 0.4 * 199 * 200 / 2).epsilon(1e-6));
+    }
+}
+
 TEST_CASE("friction on velocity", "[friction]") {
     SECTION("geometric friction at 1000fps") {
         double vel[3] = {300, 400, 500};
@@ -29,6 +159,54 @@ TEST_CASE("friction on velocity", "[friction]") {
     }
 }
 
+TEST_CASE("batched friction on velocity", "[friction]") {
+    SECTION("matches fric_vel lane for lane") {
+        const int count = 7;
+        double vx[count] = {300, 30, 0.03, -60, 0, 20, 0.5};
+        double vy[count] = {400, 40, 0.04, 80, 0, -15, 0.2};
+        double speed[count];
+        double E[count] = {100, 100, 100, 100, 100, 25, 100};
+        double tau_k[count] = {0.004, 0.004, 0.004, 0.04, 0.004, 0.01, 0.4};
+        for (int i = 0; i < count; ++i) {
+            double vel[2] = {vx[i], vy[i]};
+            speed[i] = std::sqrt(dot_product<2>(vel, vel));
+        }
+
+        double expected[count][2];
+        for (int i = 0; i < count; ++i) {
+            expected[i][0] = vx[i];
+            expected[i][1] = vy[i];
+            fric_vel(expected[i], speed[i], E[i], tau_k[i]);
+        }
+
+        fric_vel_batch(vx, vy, speed, E, tau_k, count);
+        for (int i = 0; i < count; ++i) {
+            REQUIRE(vx[i] == expected[i][0]);
+            REQUIRE(vy[i] == expected[i][1]);
+        }
+    }
+}
+
+TEST_CASE("batched friction on squared speed", "[friction]") {
+    SECTION("matches fric_speedsq lane for lane") {
+        const int count = 6;
+        double speedsq[count] = {320 * 320, 80 * 80, 100 * 100, 0.3 * 0.3, 0.05 * 0.05, 0};
+        const double E[count] = {100, 100, 100, 100, 100, 100};
+        const double tau_k[count] = {0.004, 0.004, 0.004, 0.004, 0.004, 0.004};
+        double expected[count];
+        for (int i = 0; i < count; ++i) {
+            expected[i] = fric_speedsq(speedsq[i], E[i], tau_k[i]);
+        }
+
+        fric_speedsq_batch(speedsq, E, tau_k, count);
+        for (int i = 0; i < count; ++i) {
+            REQUIRE(speedsq[i] == Approx(expected[i]).epsilon(1e-12));
+        }
+        REQUIRE(std::sqrt(speedsq[0]) == Approx(318.72));
+        REQUIRE(std::sqrt(speedsq[1]) == Approx(79.6));
+    }
+}
+
 TEST_CASE("fme on speed", "[fme]") {
     SECTION("gamma1 at 1000fps") {
         REQUIRE(fme_speed(320, 0.0175, 30, 3.2) == Approx(320.0719919018));
@@ -74,6 +252,66 @@ TEST_CASE("fme minaccel on speed", "[fme]") {
     }
 }
 
+TEST_CASE("fme minaccel over n frames", "[fme]") {
+    auto iterate = [](double speed, double L, double ke_tau_M_A, int n) {
+        for (int i = 0; i < n; ++i) {
+            speed = fme_minaccel_speed(speed, L, ke_tau_M_A);
+        }
+        return speed;
+    };
+
+    auto frames_to = [](double speed, double L, double ke_tau_M_A, double target) {
+        for (int i = 0; i < 100000; ++i) {
+            if (speed <= target) {
+                return i;
+            }
+            speed = fme_minaccel_speed(speed, L, ke_tau_M_A);
+        }
+        return -1;
+    };
+
+    SECTION("matches iterated fme_minaccel_speed") {
+        const double speeds[] = {2000, 320, 30, 3.3, 1, 0};
+        const double Ls[] = {30, 10, 0, -10};
+        const double accels[] = {3.2, 32};
+        const int frames[] = {0, 1, 2, 99, 100, 625, 626, 1000, 1001};
+        for (double speed : speeds) {
+            for (double L : Ls) {
+                for (double ke_tau_M_A : accels) {
+                    for (int n : frames) {
+                        REQUIRE(fme_minaccel_speed_n(speed, L, ke_tau_M_A, n) == Approx(iterate(speed, L, ke_tau_M_A, n)).margin(1e-9));
+                    }
+                    const double targets[] = {1000, 100, 5, 2, 0.5, 0};
+                    for (double target : targets) {
+                        REQUIRE(fme_minaccel_frames_to_speed(speed, L, ke_tau_M_A, target) == frames_to(speed, L, ke_tau_M_A, target));
+                    }
+                }
+            }
+        }
+    }
+    SECTION("oscillation near zero at 1000fps") {
+        REQUIRE(fme_minaccel_speed_n(2000, 30, 3.2, 625) == Approx(0).margin(1e-9));
+        REQUIRE(fme_minaccel_speed_n(2001, 30, 3.2, 625) == Approx(1));
+        REQUIRE(fme_minaccel_speed_n(2001, 30, 3.2, 626) == Approx(2.2));
+        REQUIRE(fme_minaccel_speed_n(2001, 30, 3.2, 100001) == Approx(1));
+        REQUIRE(fme_minaccel_speed_n(2001, 30, 3.2, 100002) == Approx(2.2));
+    }
+    SECTION("longer cycles with a non-integer L below ke_tau_M_A") {
+        REQUIRE(fme_minaccel_speed_n(8.7917427476513321, 27.555827780122016, 256, 1059) == iterate(8.7917427476513321, 27.555827780122016, 256, 1059));
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<double> unit(0, 1);
+        for (int draw = 0; draw < 20000; ++draw) {
+            const double ke_tau_M_A = draw % 2 ? 256 : 3.2;
+            const double L = unit(rng) * ke_tau_M_A;
+            const double speed = unit(rng) * ke_tau_M_A;
+            const int n = static_cast<int>(unit(rng) * 2000);
+            REQUIRE(fme_minaccel_speed_n(speed, L, ke_tau_M_A, n) == iterate(speed, L, ke_tau_M_A, n));
+            const double target = unit(rng) * ke_tau_M_A;
+            REQUIRE(fme_minaccel_frames_to_speed(speed, L, ke_tau_M_A, target) == frames_to(speed, L, ke_tau_M_A, target));
+        }
+    }
+}
+
 TEST_CASE("fme on velocity", "[fme]") {
     SECTION("120 degrees, air at 1000fps") {
         double vel[2] = {800, 500};
@@ -106,6 +344,100 @@ TEST_CASE("fme on velocity", "[fme]") {
     }
 }
 
+TEST_CASE("fme on velocity over n frames", "[fme]") {
+    auto check = [](double vx, double vy, double theta, double L, double ke_tau_M_A, int n) {
+        const double costheta = theta == 90 ? 0 : std::cos(theta * M_PI / 180);
+        const double sintheta = std::sin(theta * M_PI / 180);
+        double expected[2] = {vx, vy};
+        for (int i = 0; i < n; ++i) {
+            const double speed = std::sqrt(dot_product<2>(expected, expected));
+            fme_vel_theta(expected, speed, costheta, sintheta, L, ke_tau_M_A);
+        }
+
+        double vel[2] = {vx, vy};
+        const double speed = fme_vel_theta_n(vel, std::sqrt(vx * vx + vy * vy), costheta, sintheta, L, ke_tau_M_A, n);
+        REQUIRE(speed == Approx(std::sqrt(dot_product<2>(expected, expected))).epsilon(1e-9));
+        REQUIRE(vel[0] == Approx(expected[0]).epsilon(1e-9));
+        REQUIRE(vel[1] == Approx(expected[1]).epsilon(1e-9));
+    };
+
+    SECTION("120 degrees, air at 1000fps") {
+        check(800, 500, 120, 30, 3.2, 3000);
+    }
+    SECTION("92 degrees, air at 1000fps") {
+        check(80, 50, 92, 30, 32, 2000);
+    }
+    SECTION("90 degrees, air at 100fps") {
+        check(0, -300, 90, 30, 32, 1000);
+    }
+    SECTION("-45 degrees, ground at 250fps reaching gamma2 <= 0") {
+        check(-100, 20, -45, 320, 12.8, 500);
+    }
+}
+
+TEST_CASE("batched fme on velocity", "[fme]") {
+    SECTION("matches fme_vel_theta lane for lane") {
+        const int count = 6;
+        double vx[count] = {800, 0, -500, -100, 1000, 3};
+        double vy[count] = {500, -300, 500, 0, 0, 4};
+        double speed[count];
+        double theta[count] = {120, 90, 0, 0, 10, 45};
+        double costheta[count];
+        double sintheta[count];
+        double L[count] = {30, 30, 30, 320, 30, 30};
+        double ke_tau_M_A[count] = {3.2, 32, 3.2, 12.8, 3.2, 32};
+        for (int i = 0; i < count; ++i) {
+            double vel[2] = {vx[i], vy[i]};
+            speed[i] = std::sqrt(dot_product<2>(vel, vel));
+            costheta[i] = std::cos(theta[i] * M_PI / 180);
+            sintheta[i] = std::sin(theta[i] * M_PI / 180);
+        }
+
+        double expected[count][2];
+        for (int i = 0; i < count; ++i) {
+            expected[i][0] = vx[i];
+            expected[i][1] = vy[i];
+            fme_vel_theta(expected[i], speed[i], costheta[i], sintheta[i], L[i], ke_tau_M_A[i]);
+        }
+
+        fme_vel_theta_batch(vx, vy, speed, costheta, sintheta, L, ke_tau_M_A, count);
+        for (int i = 0; i < count; ++i) {
+            REQUIRE(vx[i] == Approx(expected[i][0]).epsilon(1e-12));
+            REQUIRE(vy[i] == Approx(expected[i][1]).epsilon(1e-12));
+        }
+    }
+}
+
+TEST_CASE("batched fme maxaccel theta", "[fme]") {
+    const int count = 5;
+    const double speed[count] = {0, 10, 26.8, 320, 1000};
+    double costheta[count];
+    double sintheta[count];
+
+    auto check = [&](double L, double ke_tau_M_A) {
+        fme_maxaccel_cossin_theta_batch(speed, L, ke_tau_M_A, costheta, sintheta, count);
+        for (int i = 0; i < count; ++i) {
+            double ct, st;
+            fme_maxaccel_cossin_theta(speed[i], L, ke_tau_M_A, &ct, &st);
+            REQUIRE(costheta[i] == Approx(ct).epsilon(1e-12));
+            REQUIRE(sintheta[i] == Approx(st).epsilon(1e-12));
+        }
+    };
+
+    SECTION("zeta and forward at 1000fps") {
+        check(30, 3.2);
+    }
+    SECTION("90 degrees at 100fps") {
+        check(30, 32);
+    }
+    SECTION("negative L") {
+        check(-30, 3.2);
+    }
+    SECTION("backward with negative A") {
+        check(-20, -3.2);
+    }
+}
+
 TEST_CASE("fme_vel_theta benchmark") {
     const double theta = 92 * M_PI / 180;
     const double costheta = std::cos(theta);
@@ -120,6 +452,12 @@ TEST_CASE("fme_vel_theta benchmark") {
         return v[0] + v[1];
     };
 
+    BENCHMARK("2000 frames composed") {
+        double v[2] = {80, 50};
+        fme_vel_theta_n(v, std::sqrt(dot_product<2>(v, v)), costheta, sintheta, 30, 0.001 * 320 * 100, 2000);
+        return v[0] + v[1];
+    };
+
     BENCHMARK("2000 frames precomputed speeds theta = 90deg") {
         double v[2] = {80, 50};
         double speedsq = dot_product<2>(v, v);
@@ -152,6 +490,86 @@ TEST_CASE("fme_vel_theta benchmark") {
         }
         return v[0] + v[1];
     };
+
+    BENCHMARK("2000 frames precomputed speeds theta = zeta batched theta") {
+        double v[2] = {80, 50};
+        Catch::Benchmark::keep_memory(v);
+        double speedsq = dot_product<2>(v, v);
+        double speeds[2000];
+        double costheta[2000];
+        double sintheta[2000];
+        double C = fme_maxaccel_speed_C(speedsq, 30, 3.2);
+        for (int i = 0; i < 2000; ++i) {
+            speeds[i] = std::sqrt(speedsq + i * C);
+        }
+        fme_maxaccel_cossin_theta_batch(speeds, 30, 3.2, costheta, sintheta, 2000);
+        for (int i = 0; i < 2000; ++i) {
+            fme_vel_theta(v, speeds[i], costheta[i], sintheta[i], 30, 3.2);
+        }
+        return v[0] + v[1];
+    };
+
+    // The speeds are hidden from the optimiser in every run, so that the angles cannot
+    // be computed once and hoisted out of the measured loop.
+    double speeds[2000];
+    for (int i = 0; i < 2000; ++i) {
+        speeds[i] = std::sqrt(80 * 80 + 50 * 50 + i * fme_maxaccel_speed_C(80 * 80 + 50 * 50, 30, 3.2));
+    }
+
+    BENCHMARK("2000 zeta angles") {
+        double costheta[2000];
+        double sintheta[2000];
+        Catch::Benchmark::keep_memory(speeds);
+        for (int i = 0; i < 2000; ++i) {
+            fme_maxaccel_cossin_theta(speeds[i], 30, 3.2, costheta + i, sintheta + i);
+        }
+        Catch::Benchmark::keep_memory(costheta);
+        Catch::Benchmark::keep_memory(sintheta);
+        return costheta[1999] + sintheta[1999];
+    };
+
+    BENCHMARK("2000 zeta angles batched") {
+        double costheta[2000];
+        double sintheta[2000];
+        Catch::Benchmark::keep_memory(speeds);
+        fme_maxaccel_cossin_theta_batch(speeds, 30, 3.2, costheta, sintheta, 2000);
+        Catch::Benchmark::keep_memory(costheta);
+        Catch::Benchmark::keep_memory(sintheta);
+        return costheta[1999] + sintheta[1999];
+    };
+}
+
+TEST_CASE("fme_vel_theta_batch benchmark") {
+    WARN("batch kernels use " << strafelib_simd_path());
+
+    const double theta = 92 * M_PI / 180;
+    const int count = 64;
+    double costheta[count];
+    double sintheta[count];
+    double L[count];
+    double ke_tau_M_A[count];
+    for (int i = 0; i < count; ++i) {
+        costheta[i] = std::cos(theta);
+        sintheta[i] = std::sin(theta);
+        L[i] = 30;
+        ke_tau_M_A[i] = 0.001 * 320 * 100;
+    }
+
+    BENCHMARK("2000 frames of 64 trajectories") {
+        double v[2 * count];
+        double *vx = v;
+        double *vy = v + count;
+        double speed[count];
+        for (int i = 0; i < count; ++i) {
+            vx[i] = 80 + i;
+            vy[i] = 50;
+        }
+        for (int j = 0; j < 2000; ++j) {
+            norm_batch<2>(v, speed, count);
+            fme_vel_theta_batch(vx, vy, speed, costheta, sintheta, L, ke_tau_M_A, count);
+        }
+        return vx[0] + vy[count - 1];
+    };
 }
 
 TEST_CASE("fme maxaccel on speed C", "[fme]") {
@@ -174,6 +592,169 @@ TEST_CASE("fme maxaccel on speed C", "[fme]") {
     }
 }
 
+TEST_CASE("fme maxaccel on speed over n frames", "[fme]") {
+    auto iterate = [](double speedsq, double L, double ke_tau_M_A, int n) {
+        for (int i = 0; i < n; ++i) {
+            speedsq += fme_maxaccel_speed_C(speedsq, L, ke_tau_M_A);
+        }
+        return std::sqrt(speedsq);
+    };
+
+    SECTION("zeta at 1000fps") {
+        const double speed = fme_maxaccel_speed_n(320 * 320, 30, 3.2, 100000);
+        REQUIRE(speed == Approx(iterate(320 * 320, 30, 3.2, 100000)).epsilon(1e-9));
+    }
+    SECTION("90 degrees at 100fps") {
+        const double speed = fme_maxaccel_speed_n(100, 30, 32, 500);
+        REQUIRE(speed == Approx(iterate(100, 30, 32, 500)).epsilon(1e-12));
+    }
+    SECTION("linear at 1000fps until zeta takes over") {
+        REQUIRE(fme_maxaccel_linear_frames(10 * 10, 30, 3.2, 1000) == 6);
+        REQUIRE(fme_maxaccel_linear_frames(10 * 10, 30, 3.2, 4) == 4);
+        REQUIRE(fme_maxaccel_linear_frames(27 * 27, 30, 3.2, 1000) == 0);
+        REQUIRE(fme_maxaccel_linear_frames(10 * 10, 30, 0, 1000) == 1000);
+        for (int n : {1, 5, 6, 7, 1000, 100000}) {
+            REQUIRE(fme_maxaccel_speed_n(10 * 10, 30, 3.2, n) == Approx(iterate(10 * 10, 30, 3.2, n)).epsilon(1e-9));
+        }
+        REQUIRE(fme_maxaccel_speed_n(0, 300, 0.1, 2000) == Approx(iterate(0, 300, 0.1, 2000)).epsilon(1e-12));
+    }
+    SECTION("backward-linear never leaves its case") {
+        REQUIRE(fme_maxaccel_linear_frames(700 * 700, 30, -3.2, 1000) == 1000);
+        REQUIRE(fme_maxaccel_linear_frames(20 * 20, -30, -3.2, 1000) == 0);
+        REQUIRE(fme_maxaccel_speed_n(700 * 700, 30, -3.2, 1000) == Approx(iterate(700 * 700, 30, -3.2, 1000)).epsilon(1e-12));
+        REQUIRE(fme_maxaccel_speed_n(40 * 40, -30, -3.2, 1000) == Approx(3240));
+    }
+}
+
+TEST_CASE("fme maxaccel frames to speed", "[fme]") {
+    auto iterate = [](double speedsq, double L, double ke_tau_M_A, double target) {
+        int frames = 0;
+        while (speedsq < target * target) {
+            speedsq += fme_maxaccel_speed_C(speedsq, L, ke_tau_M_A);
+            ++frames;
+        }
+        return frames;
+    };
+
+    SECTION("matches iterated fme_maxaccel_speed_C") {
+        const double speeds[] = {0, 10, 26.8, 100, 320};
+        const double targets[] = {5, 26.8, 30, 320, 1000};
+        for (double speed : speeds) {
+            for (double target : targets) {
+                REQUIRE(fme_maxaccel_frames_to_speed(speed * speed, 30, 3.2, target) == iterate(speed * speed, 30, 3.2, target));
+                REQUIRE(fme_maxaccel_frames_to_speed(speed * speed, 30, 32, target) == iterate(speed * speed, 30, 32, target));
+                REQUIRE(fme_maxaccel_frames_to_speed(speed * speed, 30, -3.2, target) == iterate(speed * speed, 30, -3.2, target));
+            }
+        }
+    }
+    SECTION("never reached") {
+        REQUIRE(fme_maxaccel_frames_to_speed(100, -30, 3.2, 20) == -1);
+        REQUIRE(fme_maxaccel_frames_to_speed(100, -30, -3.2, 20) == -1);
+    }
+    SECTION("more frames than an int can count") {
+        REQUIRE(fme_maxaccel_frames_to_speed(0, 30, 1e-9, 25) == -1);
+        REQUIRE(fme_maxaccel_frames_to_speed(100, 30, -1e-9, 1e6) == -1);
+        REQUIRE(fme_maxaccel_frames_to_speed(100, 30, 0, 20) == -1);
+    }
+    SECTION("long linear phases are corrected against the exact speeds") {
+        for (double ke_tau_M_A : {1e-6, -1e-6, 3e-5}) {
+            const int j = fme_maxaccel_frames_to_speed(0, 30, ke_tau_M_A, 25);
+            const double step = std::fabs(ke_tau_M_A);
+            REQUIRE(j > 0);
+            REQUIRE(j * step >= 25);
+            REQUIRE((j - 1) * step < 25);
+        }
+    }
+}
+
+TEST_CASE("fme maxaccel heading over n frames", "[fme]") {
+    auto simulate = [](double speed, double L, double ke_tau_M_A, int n) {
+        double v[2] = {speed, 0};
+        double heading = 0;
+        for (int i = 0; i < n; ++i) {
+            const double s = std::sqrt(dot_product<2>(v, v));
+            double costheta, sintheta;
+            fme_maxaccel_cossin_theta(s, L, ke_tau_M_A, &costheta, &sintheta);
+            const double old[2] = {v[0], v[1]};
+            fme_vel_theta(v, s, costheta, sintheta, L, ke_tau_M_A);
+            heading += std::atan2(old[1] * v[0] - old[0] * v[1], dot_product<2>(old, v));
+        }
+        return heading;
+    };
+
+    SECTION("zeta at 1000fps") {
+        const double expected = simulate(320, 30, 3.2, 100000);
+        REQUIRE(std::fabs(fme_maxaccel_heading_n(320 * 320, 30, 3.2, 100000, 1e-6) - expected) <= 1e-6);
+        REQUIRE(fme_maxaccel_heading_n(320 * 320, 30, 3.2, 100000, 0) == Approx(expected).epsilon(1e-9));
+    }
+    SECTION("zeta at 100fps from a low speed") {
+        const double expected = simulate(30, 30, 32 * 0.9, 20000);
+        REQUIRE(std::fabs(fme_maxaccel_heading_n(30 * 30, 30, 32 * 0.9, 20000, 1e-6) - expected) <= 1e-6);
+    }
+    SECTION("90 degrees at 100fps") {
+        const double expected = simulate(300, 30, 32, 2000);
+        REQUIRE(std::fabs(fme_maxaccel_heading_n(300 * 300, 30, 32, 2000, 1e-8) - expected) <= 1e-8);
+        REQUIRE(fme_maxaccel_heading_n(300 * 300, 30, 32, 2000, 0) == Approx(expected).epsilon(1e-9));
+    }
+    SECTION("linear start at 1000fps") {
+        const double expected = simulate(1, 30, 3.2, 5000);
+        REQUIRE(std::fabs(fme_maxaccel_heading_n(1, 30, 3.2, 5000, 1e-6) - expected) <= 1e-6);
+        REQUIRE(fme_maxaccel_heading_n(1, 30, 3.2, 8, 1e-6) == 0);
+    }
+    SECTION("backward does not turn") {
+        REQUIRE(fme_maxaccel_heading_n(700 * 700, 30, -3.2, 1000, 0) == 0);
+    }
+}
+
+TEST_CASE("fme maxaccel distance over n frames", "[fme]") {
+    auto simulate = [](double speed, double L, double ke_tau_M_A, int n, double tau, double *disp) {
+        double v[2] = {0, speed};
+        disp[0] = 0;
+        disp[1] = 0;
+        for (int i = 0; i < n; ++i) {
+            const double s = std::sqrt(dot_product<2>(v, v));
+            double costheta, sintheta;
+            fme_maxaccel_cossin_theta(s, L, ke_tau_M_A, &costheta, &sintheta);
+            fme_vel_theta(v, s, costheta, sintheta, L, ke_tau_M_A);
+            disp[0] += tau * v[0];
+            disp[1] += tau * v[1];
+        }
+    };
+
+    auto check = [&](double speed, double L, double ke_tau_M_A, int n, double tau) {
+        double expected[2];
+        simulate(speed, L, ke_tau_M_A, n, tau, expected);
+        double disp[2];
+        const double vel[2] = {0, speed};
+        fme_maxaccel_displacement_n(vel, speed, L, ke_tau_M_A, n, tau, disp);
+        const double scale = std::hypot(expected[0], expected[1]);
+        REQUIRE(std::fabs(disp[0] - expected[0]) <= 1e-9 * scale);
+        REQUIRE(std::fabs(disp[1] - expected[1]) <= 1e-9 * scale);
+    };
+
+    SECTION("zeta at 1000fps") {
+        REQUIRE(fme_maxaccel_distance_n(320 * 320, 30, 3.2, 100000, 0.001) == Approx(0.001 * [] {
+            double speedsq = 320 * 320, total = 0;
+            for (int i = 0; i < 100000; ++i) {
+                speedsq += fme_maxaccel_speed_C(speedsq, 30, 3.2);
+                total += std::sqrt(speedsq);
+            }
+            return total;
+        }()).epsilon(1e-9));
+        check(320, 30, 3.2, 5000, 0.001);
+    }
+    SECTION("linear start at 1000fps") {
+        check(1, 30, 3.2, 5000, 0.001);
+    }
+    SECTION("90 degrees at 100fps") {
+        check(300, 30, 32, 2000, 0.01);
+    }
+    SECTION("backward-linear") {
+        check(700, 30, -3.2, 1000, 0.001);
+        REQUIRE(fme_maxaccel_distance_n(700 * 700, 30, -3.2, 1000, 0.001) == Approx(0.001 * (700 * 1000 + 3.2 * 1000 * 1001 / 2)));
+    }
+}
+
 TEST_CASE("collision velocity", "[collision]") {
     SECTION("2D plane") {
         double v[2] = {1000, 0};
@@ -184,6 +765,101 @@ TEST_CASE("collision velocity", "[collision]") {
     }
 }
 
+TEST_CASE("batched collision velocity", "[collision]") {
+    SECTION("many velocities against one 3D plane") {
+        const int count = 5;
+        double v[3 * count] = {
+            1000, -20, 0, 300, 7,
+            0, 400, 250, -300, 8,
+            -50, 0, 100, 320, 9,
+        };
+        const double n[3] = {0, 0.6, 0.8};
+        double expected[count][3];
+        for (int i = 0; i < count; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                expected[i][k] = v[k * count + i];
+            }
+            collision_vel<3>(expected[i], n, 1);
+        }
+
+        collision_vel_batch<3>(v, n, 1, count);
+        for (int i = 0; i < count; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                REQUIRE(v[k * count + i] == Approx(expected[i][k]).epsilon(1e-12));
+            }
+        }
+    }
+    SECTION("one velocity clipped sequentially against 2D planes") {
+        double v[2] = {1000, 0};
+        const double n[4] = {-3. / 5, 4. / 5, 0, -1};
+        const double b[2] = {1, 1};
+        collision_vel_sequential<2>(v, n, b, 2);
+        REQUIRE(v[0] == Approx(640));
+        REQUIRE(v[1] == Approx(0).margin(1e-9));
+        // Unlike the game, the second plane clips the velocity back into the first.
+        REQUIRE(dot_product<2>(v, n) == Approx(-384));
+    }
+}
+
+TEST_CASE("collision velocity in PM_FlyMove", "[collision]") {
+    SECTION("no clip along one plane moves out of the other, so the crease stops it") {
+        double v[3] = {1000, 0, 0};
+        const double n[6] = {-3. / 5, 4. / 5, 0, 0, -1, 0};
+        collision_vel_flymove(v, n, 2, true, 1);
+        REQUIRE(v[0] == 0);
+        REQUIRE(v[1] == 0);
+        REQUIRE(v[2] == 0);
+    }
+    SECTION("sliding along the crease of two walls") {
+        double v[3] = {100, 0, 200};
+        const double n[6] = {-3. / 5, 4. / 5, 0, 0, -1, 0};
+        collision_vel_flymove(v, n, 2, true, 1);
+        REQUIRE(v[0] == 0);
+        REQUIRE(v[1] == 0);
+        REQUIRE(v[2] == Approx(0.36 * 200));
+    }
+    SECTION("one wall in the air with overbounce") {
+        double v[3] = {1000, 0, -100};
+        const double n[3] = {-3. / 5, 4. / 5, 0};
+        collision_vel_flymove(v, n, 1, false, 1.5);
+        REQUIRE(v[0] == Approx(1000 - 1.5 * 600 * 3. / 5));
+        REQUIRE(v[1] == Approx(1.5 * 600 * 4. / 5));
+        REQUIRE(v[2] == -100);
+    }
+    SECTION("a floor in the air, then a wall") {
+        double v[3] = {300, 0, -200};
+        const double n[6] = {0, 0, 1, -3. / 5, 4. / 5, 0};
+        collision_vel_flymove(v, n, 2, false, 1.5);
+        REQUIRE(v[0] == Approx(138));
+        REQUIRE(v[1] == Approx(216));
+        REQUIRE(v[2] == 0);
+    }
+    SECTION("a head-on wall in the air reflects without stopping") {
+        double v[3] = {300, 0, 0};
+        const double n[3] = {-1, 0, 0};
+        collision_vel_flymove(v, n, 1, false, 2);
+        REQUIRE(v[0] == -300);
+        REQUIRE(v[1] == 0);
+        REQUIRE(v[2] == 0);
+    }
+    SECTION("small components are zeroed") {
+        double v[3] = {1000, 0.05, -3};
+        const double n[3] = {0, 0, 1};
+        collision_vel_flymove(v, n, 1, true, 1);
+        REQUIRE(v[0] == 1000);
+        REQUIRE(v[1] == 0);
+        REQUIRE(v[2] == 0);
+    }
+    SECTION("a velocity turned backwards is zeroed") {
+        double v[3] = {300, 0, 0};
+        const double n[6] = {0, 0, 1, -1, 0, 0};
+        collision_vel_flymove(v, n, 2, true, 1);
+        REQUIRE(v[0] == 0);
+        REQUIRE(v[1] == 0);
+        REQUIRE(v[2] == 0);
+    }
+}
+
 TEST_CASE("snark_hunt_vel", "[snark]") {
     SECTION("2D vertical") {
         double v[2] = {0, -115};
@@ -194,6 +870,46 @@ TEST_CASE("snark_hunt_vel", "[snark]") {
     }
 }
 
+TEST_CASE("snark_hunt_batch", "[snark]") {
+    SECTION("matches snark_hunt_vel over several frames") {
+        const int count = 5;
+        double pos[2 * count] = {};
+        double v[2 * count] = {
+            0, 10, -300, 20, 500,
+            -115, 5, 40, 0, -500,
+        };
+        const double dir[2 * count] = {
+            0, 1, 0.6, -0.8, 1,
+            1, 0, 0.8, 0.6, 0,
+        };
+        const double tau = 0.01;
+
+        double expected_pos[count][2] = {};
+        double expected_v[count][2];
+        for (int i = 0; i < count; ++i) {
+            expected_v[i][0] = v[i];
+            expected_v[i][1] = v[count + i];
+        }
+
+        for (int frame = 0; frame < 10; ++frame) {
+            snark_hunt_batch<2>(pos, v, dir, tau, count);
+            for (int i = 0; i < count; ++i) {
+                const double d[2] = {dir[i], dir[count + i]};
+                snark_hunt_vel<2>(expected_v[i], d);
+                expected_pos[i][0] += tau * expected_v[i][0];
+                expected_pos[i][1] += tau * expected_v[i][1];
+            }
+        }
+
+        for (int i = 0; i < count; ++i) {
+            for (int k = 0; k < 2; ++k) {
+                REQUIRE(v[k * count + i] == Approx(expected_v[i][k]).epsilon(1e-12));
+                REQUIRE(pos[k * count + i] == Approx(expected_pos[i][k]).epsilon(1e-12));
+            }
+        }
+    }
+}
+
 TEST_CASE("tau_g_to_p", "[game]") {
     SECTION("72 fps") {
         REQUIRE(tau_g_to_p(1. / 72) == Approx(0.013));
@@ -212,6 +928,50 @@ TEST_CASE("tau_g_to_p", "[game]") {
     }
 }
 
+TEST_CASE("jump arc", "[jump]") {
+    // Reproduce the order of gravity and movement in the game, frame by frame.
+    auto simulate = [](double g, double tau, int frames, double *heights) {
+        double vz = JUMP_SPEED;
+        double z = 0;
+        for (int k = 1; k <= frames; ++k) {
+            vz -= 0.5 * g * tau;
+            z += vz * tau;
+            vz -= 0.5 * g * tau;
+            heights[k] = z;
+        }
+        return vz;
+    };
+
+    const double frametimes[] = {tau_g_to_p(1. / 72), tau_g_to_p(1. / 100), tau_g_to_p(1. / 250), tau_g_to_p(1. / 1000)};
+    for (double tau : frametimes) {
+        const int frames = static_cast<int>(1 / tau);
+        double heights[1001];
+        const double vz = simulate(800, tau, frames, heights);
+        REQUIRE(jump_vel_z(frames, 800, tau) == Approx(vz));
+        for (int k = 1; k <= frames; ++k) {
+            REQUIRE(jump_height(k, 800, tau) == Approx(heights[k]).margin(1e-9));
+        }
+
+        const int apex = jump_apex_frames(800, tau);
+        REQUIRE(heights[apex] > heights[apex - 1]);
+        REQUIRE(heights[apex + 1] <= heights[apex]);
+
+        const double targets[] = {-20, 0, 18, 40, heights[apex] - 1e-6};
+        for (double h : targets) {
+            int expected = apex + 1;
+            while (heights[expected] > h) {
+                ++expected;
+            }
+            REQUIRE(jump_frames_to_height(h, 800, tau) == expected);
+        }
+        REQUIRE(jump_frames_to_height(heights[apex] + 0.01, 800, tau) == -1);
+    }
+
+    SECTION("jump height at 100fps") {
+        REQUIRE(jump_height(jump_apex_frames(800, 0.01), 800, 0.01) == Approx(45).margin(0.05));
+    }
+}
+
 TEST_CASE("water_vel", "[water]") {
     SECTION("1000 fps") {
         double v[3] = {100, 0, 0};
@@ -225,3 +985,493 @@ TEST_CASE("water_vel", "[water]") {
         REQUIRE(v[2] == 0);
     }
 }
+
+TEST_CASE("water_vel over n frames", "[water]") {
+    auto check = [](const double *v0, const double *a, double geomfric, double M, double ke_tau_M_A, int n) {
+        double expected[3] = {v0[0], v0[1], v0[2]};
+        int expected_affine = -1;
+        for (int i = 0; i < n; ++i) {
+            const double speed = std::sqrt(dot_product<3>(expected, expected));
+            if (expected_affine < 0 && 0.8 * M - geomfric * speed < 0.8 * ke_tau_M_A) {
+                expected_affine = i;
+            }
+            water_vel(expected, speed, a, geomfric, M, ke_tau_M_A);
+        }
+
+        double v[3] = {v0[0], v0[1], v0[2]};
+        const int affine = water_vel_n(v, std::sqrt(dot_product<3>(v, v)), a, geomfric, M, ke_tau_M_A, n);
+        REQUIRE(affine == (expected_affine < 0 ? n : expected_affine));
+        for (int i = 0; i < 3; ++i) {
+            REQUIRE(v[i] == Approx(expected[i]).margin(1e-9));
+        }
+        return affine;
+    };
+
+    const double a[3] = {1, 0, 0};
+    SECTION("accelerating from rest at 1000fps until gamma2 limits") {
+        const double v0[3] = {0, 0, 0};
+        REQUIRE(check(v0, a, 1 - 0.001 * 4, 320, 0.001 * 320 * 10, 100) == 100);
+        REQUIRE(check(v0, a, 1 - 0.001 * 4, 320, 0.001 * 320 * 10, 5000) < 5000);
+
+        double terminal[3];
+        water_terminal_vel(terminal, a, 1 - 0.001 * 4, 320, 0.001 * 320 * 10);
+        REQUIRE(terminal[0] == Approx(256));
+    }
+    SECTION("oblique velocity at 100fps") {
+        const double v0[3] = {-100, 150, 30};
+        const double b[3] = {0.6, 0, 0.8};
+        check(v0, b, 1 - 0.01 * 4, 320, 0.01 * 320 * 10, 3000);
+    }
+    SECTION("long oblique swim at 1000fps") {
+        const double v0[3] = {-100, 150, 30};
+        check(v0, a, 1 - 0.001 * 4, 320, 0.001 * 320 * 10, 200000);
+        check(v0, a, 1 - 0.001 * 4, 320, 0.001 * 320 * 10, 2000);
+    }
+    SECTION("affine terminal velocity with a weak acceleration") {
+        const double v0[3] = {10, 20, 0};
+        check(v0, a, 1 - 0.001 * 4, 320, 0.001 * 320 * 1, 20000);
+
+        double terminal[3];
+        water_terminal_vel(terminal, a, 1 - 0.001 * 4, 320, 0.001 * 320 * 1);
+        REQUIRE(terminal[0] == Approx(64));
+        double stepped[3] = {terminal[0], terminal[1], terminal[2]};
+        water_vel(stepped, terminal[0], a, 1 - 0.001 * 4, 320, 0.001 * 320 * 1);
+        REQUIRE(stepped[0] == Approx(terminal[0]).epsilon(1e-13));
+        double v[3] = {10, 20, 0};
+        water_vel_n(v, std::sqrt(dot_product<3>(v, v)), a, 1 - 0.001 * 4, 320, 0.001 * 320 * 1, 100000);
+        REQUIRE(v[0] == Approx(terminal[0]));
+        REQUIRE(v[1] == Approx(0).margin(1e-9));
+    }
+}
+
+TEST_CASE("water_vel_batch", "[water]") {
+    SECTION("matches water_vel lane for lane") {
+        const int count = 4;
+        double v[3 * count] = {
+            100, 0, 300, 0,
+            0, 50, 0, 0,
+            0, -20, 0, 0,
+        };
+        const double a[3 * count] = {
+            1, 0, 1, 0,
+            0, 0.6, 0, 1,
+            0, 0.8, 0, 0,
+        };
+        const double geomfric[count] = {1 - 0.001 * 4, 1 - 0.001 * 4, 1 - 0.01 * 4, 1 - 0.001 * 4};
+        const double M[count] = {320, 320, 320, 0.1};
+        const double ke_tau_M_A[count] = {0.001 * 320 * 10, 0.001 * 320 * 10, 0.01 * 320 * 10, 0.001 * 10 * 0.1};
+        double speed[count];
+        double expected[count][3];
+        for (int i = 0; i < count; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                expected[i][k] = v[k * count + i];
+            }
+            speed[i] = std::sqrt(dot_product<3>(expected[i], expected[i]));
+            const double ai[3] = {a[i], a[count + i], a[2 * count + i]};
+            water_vel(expected[i], speed[i], ai, geomfric[i], M[i], ke_tau_M_A[i]);
+        }
+
+        water_vel_batch(v, speed, a, geomfric, M, ke_tau_M_A, count);
+        for (int i = 0; i < count; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                REQUIRE(v[k * count + i] == Approx(expected[i][k]).epsilon(1e-12));
+            }
+        }
+        REQUIRE(v[0] == Approx(102.16));
+        REQUIRE(v[2] == 300);
+        REQUIRE(v[count + 3] == 0);
+    }
+}
+
+TEST_CASE("player step", "[player]") {
+    const double tau = 0.001;
+    move_params<double> params = {tau, 800, 100, tau * 4, 320, tau * 320 * 10, 30, tau * 320 * 10, 0, nullptr, nullptr, nullptr, 0};
+
+    SECTION("jump follows the analytic arc and lands") {
+        player_state<double> state = {{0, 0, 0}, {400, 0, 0}, true};
+        const move_input<double> input = {0, 0, true, true};
+        const int landing = jump_frames_to_height(0, 800, tau);
+        for (int k = 1; k < landing; ++k) {
+            player_step(&state, &input, &params);
+            REQUIRE_FALSE(state.onground);
+            REQUIRE(state.pos[2] == Approx(jump_height(k, 800, tau)).margin(1e-9));
+            REQUIRE(state.vel[2] == Approx(jump_vel_z(k, 800, tau)).margin(1e-9));
+        }
+        player_step(&state, &input, &params);
+        REQUIRE(state.onground);
+        REQUIRE(state.pos[2] == 0);
+        REQUIRE(state.vel[2] == 0);
+    }
+    SECTION("ground strafing applies friction then maxaccel") {
+        player_state<double> state = {{0, 0, 0}, {100, 50, 0}, true};
+        const move_input<double> input = {0, 0, true, false};
+        for (int k = 0; k < 1000; ++k) {
+            const double speed = std::hypot(state.vel[0], state.vel[1]);
+            const double expected = fme_maxaccel_speed(fric_speed(speed, 100, tau * 4), 320, tau * 320 * 10);
+            player_step(&state, &input, &params);
+            REQUIRE(state.onground);
+            REQUIRE(std::hypot(state.vel[0], state.vel[1]) == Approx(expected).epsilon(1e-12));
+        }
+    }
+    SECTION("walls clip the velocity") {
+        const double normals[3] = {-1, 0, 0};
+        const double offsets[1] = {-10};
+        const double bounce[1] = {1};
+        params.normals = normals;
+        params.offsets = offsets;
+        params.bounce = bounce;
+        params.num_planes = 1;
+        player_state<double> state = {{9.9, 0, 0}, {300, 100, 0}, true};
+        const move_input<double> input = {1, 0, false, false};
+        player_step(&state, &input, &params);
+        REQUIRE(state.pos[0] == Approx(10));
+        REQUIRE(state.vel[0] == Approx(0).margin(1e-12));
+        REQUIRE(state.vel[1] > 0);
+    }
+    SECTION("batch matches player_step") {
+        const double normals[3] = {0, -1, 0};
+        const double offsets[1] = {-5};
+        const double bounce[1] = {1};
+        params.normals = normals;
+        params.offsets = offsets;
+        params.bounce = bounce;
+        params.num_planes = 1;
+
+        // Six cases repeated over more lanes than a block of player_step_batch().
+        const int cases = 6;
+        const double vx_cases[cases] = {0, 50, 320, 700, 10, 0.05};
+        const double vy_cases[cases] = {0, 30, -20, 100, 0, 0};
+        const bool onground_cases[cases] = {true, true, false, true, false, true};
+        const bool jump_cases[cases] = {false, true, false, false, true, false};
+        const double costheta_cases[cases] = {0, 0.2, -0.5, 1, 0.9, 0};
+        const int count = 150;
+        double vx0[count];
+        double vy0[count];
+        bool onground0[count];
+        bool jump[count];
+        double costheta[count];
+        double sintheta[count];
+        for (int i = 0; i < count; ++i) {
+            vx0[i] = vx_cases[i % cases];
+            vy0[i] = vy_cases[i % cases];
+            onground0[i] = onground_cases[i % cases];
+            jump[i] = jump_cases[i % cases];
+            costheta[i] = costheta_cases[i % cases];
+            sintheta[i] = std::sqrt(1 - costheta[i] * costheta[i]);
+        }
+
+        for (bool maxaccel : {false, true}) {
+            player_state<double> states[count];
+            double pos[3 * count] = {};
+            double vel[3 * count] = {};
+            bool onground[count];
+            for (int i = 0; i < count; ++i) {
+                states[i] = {{0, 0, 0}, {vx0[i], vy0[i], 0}, onground0[i]};
+                vel[i] = vx0[i];
+                vel[count + i] = vy0[i];
+                onground[i] = onground0[i];
+            }
+            for (int k = 0; k < 300; ++k) {
+                for (int i = 0; i < count; ++i) {
+                    const move_input<double> input = {costheta[i], sintheta[i], maxaccel, jump[i]};
+                    player_step(&states[i], &input, &params);
+                }
+                player_step_batch(pos, vel, onground, costheta, sintheta, jump, maxaccel, &params, count);
+                for (int i = 0; i < count; ++i) {
+                    REQUIRE(onground[i] == states[i].onground);
+                    for (int c = 0; c < 3; ++c) {
+                        REQUIRE(pos[c * count + i] == Approx(states[i].pos[c]).epsilon(1e-12).margin(1e-12));
+                        REQUIRE(vel[c * count + i] == Approx(states[i].vel[c]).epsilon(1e-12).margin(1e-12));
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("trajectory recording", "[trajectory]") {
+    alignas(64) static char buffer[1 << 14];
+    arena a;
+    arena_init(&a, buffer, sizeof(buffer));
+
+    SECTION("arena allocations are aligned and bounded") {
+        char *c = arena_alloc<char>(&a, 1);
+        double *d = arena_alloc<double>(&a, 3);
+        REQUIRE(c == buffer);
+        REQUIRE(reinterpret_cast<std::uintptr_t>(d) % 64 == 0);
+        REQUIRE(arena_alloc<double>(&a, sizeof(buffer) / sizeof(double)) == nullptr);
+        REQUIRE(a.used == 64 + 3 * sizeof(double));
+        arena_reset(&a);
+        REQUIRE(arena_alloc<char>(&a, 1) == buffer);
+    }
+    SECTION("record a jump and reuse the storage") {
+        const int capacity = 200;
+        REQUIRE(trajectory_arena_bytes(capacity) <= sizeof(buffer));
+        trajectory<double> traj;
+        REQUIRE(trajectory_init(&traj, &a, capacity));
+        REQUIRE(a.used <= trajectory_arena_bytes(capacity));
+        trajectory<double> other;
+        REQUIRE_FALSE(trajectory_init(&other, &a, capacity));
+
+        const move_params<double> params = {0.01, 800, 100, 0.04, 320, 32, 30, 32, 0, nullptr, nullptr, nullptr, 0};
+        const move_input<double> input = {0, 0, true, true};
+        const double *columns = traj.pos;
+        for (int run = 0; run < 2; ++run) {
+            trajectory_reset(&traj);
+            player_state<double> state = {{0, 0, 0}, {300, 0, 0}, true};
+            for (int k = 0; k < capacity; ++k) {
+                player_step(&state, &input, &params);
+                REQUIRE(trajectory_record(&traj, state.pos, state.vel, std::hypot(state.vel[0], state.vel[1])));
+            }
+            REQUIRE_FALSE(trajectory_record(&traj, state.pos, state.vel, 0.0));
+            REQUIRE(traj.size == capacity);
+            REQUIRE(traj.pos == columns);
+            REQUIRE(traj.pos[capacity - 1] == state.pos[0]);
+            REQUIRE(traj.vel[2 * capacity + capacity - 1] == state.vel[2]);
+            REQUIRE(traj.pos[2 * capacity + 10] == Approx(jump_height(11, 800, 0.01)));
+            REQUIRE(traj.speed[0] == Approx(fme_maxaccel_speed(300, 30, 32)));
+        }
+    }
+}
+
+TEST_CASE("thread pool", "[parallel]") {
+    thread_pool pool(4);
+    REQUIRE(pool.size() == 4);
+    for (int round = 0; round < 100; ++round) {
+        std::atomic<int> calls(0);
+        std::atomic<int> workers(0);
+        pool.run([&](int worker) {
+            ++calls;
+            workers |= 1 << worker;
+        });
+        REQUIRE(calls == 4);
+        REQUIRE(workers == 15);
+    }
+    REQUIRE_THROWS(pool.run([](int worker) {
+        if (worker == 2) {
+            throw std::runtime_error("worker failed");
+        }
+    }));
+}
+
+TEST_CASE("ensemble of strafing runs", "[parallel]") {
+    const int count = 1000;
+    const int frames = 500;
+    std::vector<ensemble_input<double>> inputs(count);
+    for (int i = 0; i < count; ++i) {
+        const double theta = 0.01 * (i % 157);
+        const double tau = tau_g_to_p(1. / (100 + i % 900));
+        inputs[i] = {double(i % 7 == 0 ? 0 : i % 400), std::cos(theta), std::sin(theta), tau, i % 2 ? 30. : 320., tau * 320 * (i % 3 ? 10 : 100)};
+    }
+
+    for (bool ground : {false, true}) {
+        std::vector<ensemble_summary<double>> out(count);
+        thread_pool pool(3);
+        run_ensemble(pool, inputs.data(), out.data(), count, frames, ground, 100, 4);
+        for (int i = 0; i < count; ++i) {
+            const ensemble_input<double> &in = inputs[i];
+            double vel[2] = {in.speed, 0};
+            double speed = in.speed;
+            double distance = 0;
+            for (int f = 0; f < frames; ++f) {
+                if (ground) {
+                    fric_vel(vel, speed, 100, in.tau * 4);
+                    speed = std::hypot(vel[0], vel[1]);
+                }
+                if (speed > 0) {
+                    fme_vel_theta(vel, speed, in.costheta, in.sintheta, in.L, in.ke_tau_M_A);
+                }
+                speed = std::hypot(vel[0], vel[1]);
+                distance += in.tau * speed;
+            }
+            REQUIRE(out[i].vel[0] == Approx(vel[0]).epsilon(1e-9).margin(1e-9));
+            REQUIRE(out[i].vel[1] == Approx(vel[1]).epsilon(1e-9).margin(1e-9));
+            REQUIRE(out[i].speed == Approx(speed).epsilon(1e-9).margin(1e-9));
+            REQUIRE(out[i].distance == Approx(distance).epsilon(1e-9).margin(1e-9));
+        }
+    }
+}
+
+TEST_CASE("work-stealing sweep", "[parallel]") {
+    thread_pool pool(4);
+
+    SECTION("every index is visited once") {
+        for (int count : {0, 1, 3, 1000, 12345}) {
+            std::vector<std::atomic<int>> visits(count);
+            for (auto &v : visits) {
+                v = 0;
+            }
+            std::atomic<int> late_work(0);
+            parallel_for_stealing(pool, count, 2, [&](int i, int) {
+                ++visits[i];
+                // Make the last indices much more expensive, as in a skewed sweep.
+                if (i > count * 3 / 4) {
+                    for (int j = 0; j < 2000; ++j) {
+                        late_work += j & 1;
+                    }
+                }
+            });
+            for (auto &v : visits) {
+                REQUIRE(v == 1);
+            }
+        }
+    }
+    SECTION("dense grid matches serial evaluation") {
+        // Frames until the FME at a constant angle reaches 600 ups, or -1 if it never does.
+        auto frames_to_600 = [](double tau, double costheta, double, double L, double ke_tau_M_A) {
+            double speed = 300;
+            for (int f = 0; f < 20000; ++f) {
+                const double next = fme_speed(speed, costheta, L, ke_tau_M_A);
+                if (next >= 600) {
+                    return double(f + 1);
+                }
+                if (next <= speed) {
+                    return -1.0;
+                }
+                speed = next;
+            }
+            return -tau;
+        };
+
+        const double fps[] = {72, 100, 250, 1000};
+        double theta[20];
+        for (int i = 0; i < 20; ++i) {
+            theta[i] = 0.08 * i;
+        }
+        const double L[] = {30, 320};
+        const double ke_M_A[] = {3200, 32000, -3200};
+        const sweep_axes<double> axes = {fps, 4, theta, 20, L, 2, ke_M_A, 3};
+        std::vector<double> grid(4 * 20 * 2 * 3);
+        sweep_grid(pool, axes, grid.data(), frames_to_600);
+
+        int cell = 0;
+        for (double f : fps) {
+            const double tau = tau_g_to_p(1 / f);
+            for (double t : theta) {
+                for (double l : L) {
+                    for (double k : ke_M_A) {
+                        REQUIRE(grid[cell] == frames_to_600(tau, std::cos(t), std::sin(t), l, tau * k));
+                        ++cell;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("replay re-simulation", "[replay]") {
+    const int num_frames = 10000;
+    const int interval = 64;
+    const double normals[6] = {-1, 0, 0, 0, -1, 0};
+    const double offsets[2] = {-10, -10};
+    const double bounce[2] = {1, 1};
+    move_params<double> params = {0.001, 800, 100, 0.004, 320, 32, 30, 32, 0, normals, offsets, bounce, 2};
+    const player_state<double> initial = {{-300, -200, 0}, {200, 100, 0}, true};
+
+    std::vector<move_input<double>> inputs(num_frames, move_input<double>{1, 0, false, false});
+    std::vector<player_state<double>> checkpoints(replay_num_checkpoints(num_frames, interval));
+    replay<double> r = {params, inputs.data(), checkpoints.data(), num_frames, interval};
+    replay_init(&r, initial);
+
+    auto check_against_fresh = [&]() {
+        std::vector<player_state<double>> fresh(checkpoints.size());
+        replay<double> f = {r.params, inputs.data(), fresh.data(), num_frames, interval};
+        replay_init(&f, initial);
+        for (size_t i = 0; i < fresh.size(); ++i) {
+            REQUIRE(player_state_identical(fresh[i], checkpoints[i]));
+        }
+        const player_state<double> a = replay_state(&r, num_frames);
+        const player_state<double> b = replay_state(&f, num_frames);
+        REQUIRE(player_state_identical(a, b));
+    };
+
+    SECTION("an edit converging in the corner stops early") {
+        REQUIRE(replay_state(&r, num_frames).pos[0] == 10);
+        REQUIRE(replay_state(&r, num_frames).pos[1] == 10);
+        inputs[100].jump = true;
+        inputs[101].costheta = -1;
+        const int frames = replay_edit(&r, 100, 102);
+        REQUIRE(frames < num_frames / 2);
+        check_against_fresh();
+    }
+    SECTION("an edit without walls simulates to the end") {
+        r.params.num_planes = 0;
+        replay_init(&r, initial);
+        inputs[5000].costheta = -1;
+        REQUIRE(replay_edit(&r, 5000, 5001) == num_frames - 4992);
+        check_against_fresh();
+    }
+    SECTION("a no-op edit converges at the next checkpoint") {
+        REQUIRE(replay_edit(&r, 3000, 3001) == 3008 - 2944);
+        check_against_fresh();
+    }
+}
+
+TEST_CASE("single precision primitives", "[float]") {
+    const float tol = 5e-7f;
+
+    SECTION("scalar speeds") {
+        REQUIRE(fric_speed<float>(320, 100, 4. / 1000) == Approx(318.72).epsilon(tol));
+        REQUIRE(fme_maxaccel_speed<float>(1000, 30, 3.2) == Approx(1000.0908758707881).epsilon(tol));
+        REQUIRE(fme_minaccel_speed<float>(2000, 30, 3.2) == Approx(1996.8).epsilon(tol));
+        REQUIRE(tau_g_to_p<float>(1.f / 100) == Approx(0.01).epsilon(tol));
+    }
+
+    SECTION("batch kernels within the documented bound of the double kernels") {
+        const int count = 256;
+        double vx[count], vy[count], speed[count], E[count], tau_k[count];
+        double costheta[count], sintheta[count], L[count], ke_tau_M_A[count];
+        float fvx[count], fvy[count], fspeed[count], fE[count], ftau_k[count];
+        float fcostheta[count], fsintheta[count], fL[count], fke_tau_M_A[count];
+        for (int i = 0; i < count; ++i) {
+            fvx[i] = 2.5f * i - 200;
+            fvy[i] = 300 - 1.5f * i;
+            fE[i] = 100;
+            ftau_k[i] = 0.004f;
+            fL[i] = 30;
+            fke_tau_M_A[i] = 3.2f;
+            fcostheta[i] = std::cos(0.01f * i);
+            fsintheta[i] = std::sin(0.01f * i);
+            vx[i] = fvx[i];
+            vy[i] = fvy[i];
+            E[i] = fE[i];
+            tau_k[i] = ftau_k[i];
+            L[i] = fL[i];
+            ke_tau_M_A[i] = fke_tau_M_A[i];
+            costheta[i] = fcostheta[i];
+            sintheta[i] = fsintheta[i];
+        }
+
+        for (int frame = 0; frame < 100; ++frame) {
+            for (int i = 0; i < count; ++i) {
+                speed[i] = std::sqrt(vx[i] * vx[i] + vy[i] * vy[i]);
+                fspeed[i] = std::sqrt(fvx[i] * fvx[i] + fvy[i] * fvy[i]);
+            }
+            if (frame % 2) {
+                fric_vel_batch(vx, vy, speed, E, tau_k, count);
+                fric_vel_batch(fvx, fvy, fspeed, fE, ftau_k, count);
+            } else {
+                fme_vel_theta_batch(vx, vy, speed, costheta, sintheta, L, ke_tau_M_A, count);
+                fme_vel_theta_batch(fvx, fvy, fspeed, fcostheta, fsintheta, fL, fke_tau_M_A, count);
+            }
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const double err = std::hypot(fvx[i] - vx[i], fvy[i] - vy[i]);
+            REQUIRE(err <= 100 * tol * std::hypot(vx[i], vy[i]));
+        }
+    }
+
+    SECTION("vector primitives") {
+        float v[2] = {1000, 0};
+        const float n[2] = {-3.f / 5, 4.f / 5};
+        collision_vel<2>(v, n, 1);
+        REQUIRE(v[0] == Approx(640).epsilon(tol));
+        REQUIRE(v[1] == Approx(480).epsilon(tol));
+
+        float w[3] = {100, 0, 0};
+        const float a[3] = {1, 0, 0};
+        water_vel(w, 100.f, a, 1 - 0.001 * 4, 320, 0.001 * 320 * 10);
+        REQUIRE(w[0] == Approx(102.16).epsilon(tol));
+    }
+}